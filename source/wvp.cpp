@@ -1,8 +1,12 @@
 #include "wvp.h"
 #include "wvp_model.h"
+#include "wvp_quantizer.h"
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <filesystem>
+#include <map>
+#include <mutex>
 #include <vamp-sdk/PluginAdapter.h>
 
 #if defined(_MSC_VER)
@@ -85,7 +89,7 @@ namespace Wvp
         return {};
     }
 
-    static std::vector<std::filesystem::path> getModelPaths()
+    std::vector<std::filesystem::path> getModelPaths()
     {
         std::vector<std::filesystem::path> allPaths;
         if(auto const* envModelPath = std::getenv("WHISPERMODELSPATH"))
@@ -125,6 +129,101 @@ namespace Wvp
 #endif
         return allPaths;
     }
+
+    std::filesystem::path getCacheDirectory()
+    {
+        if(auto const* envCachePath = std::getenv("WHISPERCACHEPATH"))
+        {
+            return std::filesystem::path{envCachePath};
+        }
+#ifdef __APPLE__
+        if(auto const* userPath = std::getenv("HOME"))
+        {
+            return std::filesystem::path(userPath) / "Library/Application Support/Ircam/whispermodels/cache";
+        }
+#elif __linux__
+        if(auto const* userPath = std::getenv("HOME"))
+        {
+            return std::filesystem::path(userPath) / ".config/Ircam/whispermodels/cache";
+        }
+#elif _WIN32
+        auto const userPath = getSpecialFolderPath(CSIDL_APPDATA);
+        if(!userPath.empty())
+        {
+            return std::filesystem::path(userPath) / "Ircam/whispermodels/cache";
+        }
+#endif
+        return {};
+    }
+
+    static std::atomic<TranscriptionHook> gTranscriptionHook{nullptr};
+
+    void setTranscriptionHook(TranscriptionHook hook)
+    {
+        gTranscriptionHook = hook;
+    }
+
+    // The model contexts are shared by all the plugin instances (each instance owns its own state),
+    // so the model is loaded once as long as an instance uses it.
+    static std::shared_ptr<whisper_context> getContext(size_t modelIndex, Quantizer::Type quantization)
+    {
+        // The global mutex only protects the map, each entry has its own mutex so loading (and
+        // quantizing) a model doesn't block the instances using other models
+        struct Entry
+        {
+            std::mutex mutex;
+            std::weak_ptr<whisper_context> context;
+        };
+        static std::mutex mutex;
+        static std::map<std::string, std::shared_ptr<Entry>> entries;
+
+        std::filesystem::path source;
+        if(modelIndex > 0)
+        {
+            auto const models = getModelPaths();
+            if(modelIndex > models.size())
+            {
+                return nullptr;
+            }
+            source = models.at(modelIndex - 1);
+        }
+
+        auto const key = source.empty() ? std::string{} : source.string() + ":" + Quantizer::getTypeNames().at(static_cast<size_t>(quantization));
+        std::shared_ptr<Entry> entry;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto& value = entries[key];
+            if(value == nullptr)
+            {
+                value = std::make_shared<Entry>();
+            }
+            entry = value;
+        }
+
+        std::lock_guard<std::mutex> lock(entry->mutex);
+        if(auto context = entry->context.lock())
+        {
+            return context;
+        }
+        auto params = whisper_context_default_params();
+        whisper_context* handle = nullptr;
+        if(source.empty())
+        {
+            handle = whisper_init_from_buffer_with_params_no_state(const_cast<void*>(Wvp::model), Wvp::model_size, params);
+        }
+        else
+        {
+            auto const path = Quantizer::getModel(source, getCacheDirectory(), quantization).string();
+            handle = whisper_init_from_file_with_params_no_state(path.c_str(), params);
+        }
+        if(handle == nullptr)
+        {
+            return nullptr;
+        }
+        auto context = std::shared_ptr<whisper_context>(handle, whisper_free);
+        entry->context = context;
+        return context;
+    }
 } // namespace Wvp
 
 void Wvp::Plugin::Resampler::prepare(double sampleRate)
@@ -189,14 +288,19 @@ double Wvp::Plugin::Resampler::getRatio() const noexcept
 Wvp::Plugin::Plugin(float inputSampleRate)
 : Vamp::Plugin(inputSampleRate)
 {
-    whisper_log_set([](enum ggml_log_level level, const char* text, void* user_data)
-                    {
-                        if(level <= GGML_LOG_LEVEL_WARN)
-                        {
-                            std::cerr << text << "\n";
-                        }
-                    },
-                    nullptr);
+    // The logger of whisper is global so it's installed once (plugins can be created concurrently)
+    static std::once_flag logFlag;
+    std::call_once(logFlag, []()
+                   {
+                       whisper_log_set([](enum ggml_log_level level, const char* text, void* user_data)
+                                       {
+                                           if(level <= GGML_LOG_LEVEL_WARN)
+                                           {
+                                               std::cerr << text << "\n";
+                                           }
+                                       },
+                                       nullptr);
+                   });
     mResampler.prepare(static_cast<double>(inputSampleRate));
 }
 
@@ -209,7 +313,7 @@ bool Wvp::Plugin::initialise(size_t channels, size_t stepSize, size_t blockSize)
     reset();
     mBuffer.reserve(gModelSampleRate * 2);
     mBlockSize = blockSize;
-    return mHandle != nullptr;
+    return mState != nullptr;
 }
 
 std::string Wvp::Plugin::getIdentifier() const
@@ -309,28 +413,24 @@ Wvp::Plugin::OutputList Wvp::Plugin::getOutputDescriptors() const
 
 void Wvp::Plugin::reset()
 {
-    auto const createContext = [this]() -> struct whisper_context*
+    // The state (with its KV cache and compute buffers) is reused as long as the model doesn't change
+    if(mState == nullptr || mStateModelIndex != mModelIndex || mStateQuantization != mQuantization)
     {
-        auto params = whisper_context_default_params();
-        if(mModelIndex == 0)
+        mState.reset();
+        mContext = getContext(mModelIndex, static_cast<Quantizer::Type>(mQuantization));
+        mStateModelIndex = mModelIndex;
+        mStateQuantization = mQuantization;
+        if(mContext != nullptr)
         {
-            return whisper_init_from_buffer_with_params(const_cast<void*>(Wvp::model), Wvp::model_size, params);
+            mState = state_uptr(whisper_init_state(mContext.get()), [](whisper_state* state)
+                                {
+                                    if(state != nullptr)
+                                    {
+                                        whisper_free_state(state);
+                                    }
+                                });
         }
-        auto const models = getModelPaths();
-        if(mModelIndex <= models.size())
-        {
-            auto const path = models.at(mModelIndex - 1).string();
-            return whisper_init_from_file_with_params(path.c_str(), params);
-        }
-        return nullptr;
-    };
-    mHandle = handle_uptr(createContext(), [](whisper_context* ctx)
-                          {
-                              if(ctx != nullptr)
-                              {
-                                  whisper_free(ctx);
-                              }
-                          });
+    }
     mBuffer.clear();
     mRanges.clear();
     mBufferPosition = 0;
@@ -360,6 +460,19 @@ Wvp::Plugin::ParameterList Wvp::Plugin::getParameterDescriptors() const
         param.isQuantized = true;
         param.quantizeStep = 1.0f;
         list.push_back(std::move(param));
+
+        ParameterDescriptor quantization;
+        quantization.identifier = "quantization";
+        quantization.name = "Quantization";
+        quantization.description = "The type used to quantize the non-quantized models at loading (the quantized models are cached)";
+        quantization.unit = "";
+        quantization.valueNames = Quantizer::getTypeNames();
+        quantization.minValue = 0.0f;
+        quantization.maxValue = static_cast<float>(quantization.valueNames.size() - 1);
+        quantization.defaultValue = 0.0f;
+        quantization.isQuantized = true;
+        quantization.quantizeStep = 1.0f;
+        list.push_back(std::move(quantization));
     }
     {
         ParameterDescriptor param;
@@ -398,6 +511,11 @@ void Wvp::Plugin::setParameter(std::string paramid, float newval)
         auto const max = static_cast<float>(getModelPaths().size());
         mModelIndex = static_cast<size_t>(std::floor(std::clamp(newval, 0.0f, max)));
     }
+    else if(paramid == "quantization")
+    {
+        auto const max = static_cast<float>(Quantizer::getTypeNames().size() - 1);
+        mQuantization = static_cast<size_t>(std::floor(std::clamp(newval, 0.0f, max)));
+    }
     else if(paramid == "splitmode")
     {
         mSplitMode = static_cast<size_t>(std::floor(std::clamp(newval, 0.0f, 2.0f)));
@@ -418,6 +536,10 @@ float Wvp::Plugin::getParameter(std::string paramid) const
     {
         return static_cast<float>(mModelIndex);
     }
+    if(paramid == "quantization")
+    {
+        return static_cast<float>(mQuantization);
+    }
     if(paramid == "splitmode")
     {
         return static_cast<float>(mSplitMode);
@@ -450,7 +572,7 @@ Wvp::Plugin::OutputExtraList Wvp::Plugin::getOutputExtraDescriptors(size_t outpu
     return list;
 }
 
-Wvp::Plugin::FeatureList Wvp::Plugin::getCurrentFeatures(size_t timeOffset)
+void Wvp::Plugin::getCurrentFeatures(size_t timeOffset, FeatureList& fl)
 {
     auto params = whisper_full_default_params(whisper_sampling_strategy::WHISPER_SAMPLING_GREEDY);
     params.no_context = true;
@@ -469,54 +591,81 @@ Wvp::Plugin::FeatureList Wvp::Plugin::getCurrentFeatures(size_t timeOffset)
         mBuffer.resize(minSize, 0.0f);
         mBufferPosition = minSize;
     }
-    if(whisper_full(mHandle.get(), params, mBuffer.data(), static_cast<int>(mBufferPosition)) != 0)
+    auto const hook = gTranscriptionHook.load();
+    if(hook != nullptr)
+    {
+        hook(true);
+    }
+    auto const result = whisper_full_with_state(mContext.get(), mState.get(), params, mBuffer.data(), static_cast<int>(mBufferPosition));
+    if(hook != nullptr)
+    {
+        hook(false);
+    }
+    if(result != 0)
     {
         std::cerr << "Failed to process\n";
     }
     mBuffer.clear();
     mBufferPosition = 0;
-    FeatureList fl;
     auto const offset = Vamp::RealTime::frame2RealTime(static_cast<long>(timeOffset), static_cast<int>(getInputSampleRate()));
-    auto const nsegments = whisper_full_n_segments(mHandle.get());
+    auto const nsegments = whisper_full_n_segments_from_state(mState.get());
+    // The exact number of features is reserved so the list is allocated once
+    auto nfeatures = fl.size();
+    for(int i = 0; i < nsegments; ++i)
+    {
+        if(mSplitMode < 2)
+        {
+            ++nfeatures;
+        }
+        else
+        {
+            auto const ntokens = whisper_full_n_tokens_from_state(mState.get(), i);
+            for(int j = 0; j < ntokens; ++j)
+            {
+                if(!mSuppressNonSpeechTokens || whisper_full_get_token_id_from_state(mState.get(), i, j) < whisper_token_eot(mContext.get()))
+                {
+                    ++nfeatures;
+                }
+            }
+        }
+    }
+    fl.reserve(nfeatures);
     for(int i = 0; i < nsegments; ++i)
     {
         if(mSplitMode < 2)
         {
-            auto const* text = whisper_full_get_segment_text(mHandle.get(), i);
-            auto const t0 = whisper_full_get_segment_t0(mHandle.get(), i);
-            auto const t1 = whisper_full_get_segment_t1(mHandle.get(), i);
-            Feature feature;
+            auto const* text = whisper_full_get_segment_text_from_state(mState.get(), i);
+            auto const t0 = whisper_full_get_segment_t0_from_state(mState.get(), i);
+            auto const t1 = whisper_full_get_segment_t1_from_state(mState.get(), i);
+            auto& feature = fl.emplace_back();
             feature.hasTimestamp = true;
             auto const time = Vamp::RealTime::fromSeconds(static_cast<double>(t0) / 100.0);
             feature.timestamp = time + offset;
             feature.hasDuration = true;
             feature.duration = Vamp::RealTime::fromSeconds(static_cast<double>(t1) / 100.0) - time;
             feature.label = text;
-            feature.values.push_back(1.0);
-            fl.push_back(std::move(feature));
+            feature.values.assign(1, 1.0f);
         }
         else
         {
-            auto const ntokens = whisper_full_n_tokens(mHandle.get(), i);
+            auto const ntokens = whisper_full_n_tokens_from_state(mState.get(), i);
             for(int j = 0; j < ntokens; ++j)
             {
-                auto const data = whisper_full_get_token_data(mHandle.get(), i, j);
-                if(!mSuppressNonSpeechTokens || data.id < whisper_token_eot(mHandle.get()))
+                auto const data = whisper_full_get_token_data_from_state(mState.get(), i, j);
+                if(!mSuppressNonSpeechTokens || data.id < whisper_token_eot(mContext.get()))
                 {
-                    Feature feature;
+                    auto& feature = fl.emplace_back();
                     feature.hasTimestamp = true;
                     auto const time = Vamp::RealTime::fromSeconds(static_cast<double>(data.t0) / 100.0);
                     feature.timestamp = time + offset;
                     feature.hasDuration = true;
                     feature.duration = Vamp::RealTime::fromSeconds(static_cast<double>(data.t1) / 100.0) - time;
-                    feature.label = whisper_full_get_token_text(mHandle.get(), i, j);
-                    feature.values.push_back(data.p);
-                    fl.push_back(std::move(feature));
+                    feature.label = whisper_full_get_token_text_from_state(mContext.get(), mState.get(), i, j);
+                    feature.values.assign(1, data.p);
                 }
             }
         }
     }
-    return fl;
 }
 
 Wvp::Plugin::FeatureSet Wvp::Plugin::process(float const* const* inputBuffers, [[maybe_unused]] Vamp::RealTime timestamp)
@@ -544,7 +693,8 @@ Wvp::Plugin::FeatureSet Wvp::Plugin::process(float const* const* inputBuffers, [
         blockSize -= subBlockSize;
     };
 
-    FeatureList fl;
+    // The feature set remains empty (and so doesn't allocate) as long as no sequence is processed
+    FeatureSet fs;
     while(blockSize > 0)
     {
         auto const nextTime = mRanges.upper_bound(mAdvancement);
@@ -558,8 +708,7 @@ Wvp::Plugin::FeatureSet Wvp::Plugin::process(float const* const* inputBuffers, [
             else
             {
                 pushSamples(diffSamples);
-                auto const result = getCurrentFeatures(nextTime == mRanges.cbegin() ? 0.0 : *std::prev(nextTime));
-                fl.insert(fl.end(), result.cbegin(), result.cend());
+                getCurrentFeatures(nextTime == mRanges.cbegin() ? 0 : *std::prev(nextTime), fs[0]);
             }
         }
         else
@@ -567,17 +716,20 @@ Wvp::Plugin::FeatureSet Wvp::Plugin::process(float const* const* inputBuffers, [
             pushSamples(blockSize);
         }
     }
-    return {{0, fl}};
+    return fs;
 }
 
 Wvp::Plugin::FeatureSet Wvp::Plugin::getRemainingFeatures()
 {
+    FeatureSet fs;
     if(mRanges.empty())
     {
-        return {{0, getCurrentFeatures(0.0)}};
+        getCurrentFeatures(0, fs[0]);
+        return fs;
     }
     auto const nextTime = mRanges.upper_bound(mAdvancement);
-    return {{0, getCurrentFeatures(nextTime == mRanges.cbegin() ? 0.0 : *std::prev(nextTime))}};
+    getCurrentFeatures(nextTime == mRanges.cbegin() ? 0 : *std::prev(nextTime), fs[0]);
+    return fs;
 }
 
 #ifdef __cplusplus
@@ -2,12 +2,26 @@
 
 #include <IvePluginAdapter.hpp>
 #include <array>
+#include <filesystem>
 #include <memory>
 #include <set>
+#include <string>
+#include <vector>
 #include <whisper.h>
 
 namespace Wvp
 {
+    // The models installed on the system (the model parameter uses the index plus one, zero being the embedded model)
+    std::vector<std::filesystem::path> getModelPaths();
+
+    // The directory where the quantized models are stored
+    std::filesystem::path getCacheDirectory();
+
+    // A function called with true before and false after each transcription by whisper
+    // (used by the tests to tell the allocations of whisper apart from those of the plugin)
+    using TranscriptionHook = void (*)(bool started);
+    void setTranscriptionHook(TranscriptionHook hook);
+
     class Plugin
     : public Vamp::Plugin
     , public Ive::PluginExtension
@@ -47,7 +61,7 @@ namespace Wvp
         OutputExtraList getOutputExtraDescriptors(size_t outputDescriptorIndex) const override;
 
     private:
-        FeatureList getCurrentFeatures(size_t timeOffset);
+        void getCurrentFeatures(size_t timeOffset, FeatureList& fl);
 
         static auto constexpr gModelSampleRate = 16000;
 
@@ -72,14 +86,18 @@ namespace Wvp
             size_t mIndexBuffer{0};
         };
 
-        using handle_uptr = std::unique_ptr<whisper_context, void (*)(whisper_context*)>;
-        handle_uptr mHandle{nullptr, nullptr};
+        using state_uptr = std::unique_ptr<whisper_state, void (*)(whisper_state*)>;
+        std::shared_ptr<whisper_context> mContext;
+        state_uptr mState{nullptr, nullptr};
+        size_t mStateModelIndex{0};
+        size_t mStateQuantization{0};
         Resampler mResampler;
         std::vector<float> mBuffer;
         size_t mBufferPosition{0};
         size_t mAdvancement{0};
         size_t mBlockSize{0};
         size_t mModelIndex{0};
+        size_t mQuantization{0};
         size_t mSplitMode{2};
         bool mSuppressNonSpeechTokens{true};
         std::set<size_t> mRanges;
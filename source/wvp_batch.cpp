@@ -0,0 +1,1027 @@
+#include "wvp.h"
+#include "wvp_quantizer.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace Wvp
+{
+    namespace Batch
+    {
+        // A streaming reader for RIFF/WAVE files (PCM 8/16/24/32 bits and float 32/64 bits) that mixes the channels down to mono
+        class WavReader
+        {
+        public:
+            WavReader() = default;
+            ~WavReader() = default;
+
+            bool open(std::filesystem::path const& path, std::string& error)
+            {
+                mStream.open(path, std::ios::binary);
+                if(!mStream)
+                {
+                    error = "cannot open the file";
+                    return false;
+                }
+                char header[12];
+                if(!mStream.read(header, sizeof(header)) || std::memcmp(header, "RIFF", 4) != 0 || std::memcmp(header + 8, "WAVE", 4) != 0)
+                {
+                    error = "not a RIFF/WAVE file";
+                    return false;
+                }
+                auto hasFormat = false;
+                char chunk[8];
+                while(mStream.read(chunk, sizeof(chunk)))
+                {
+                    auto const size = static_cast<uint32_t>(getUnsigned(reinterpret_cast<unsigned char const*>(chunk + 4), 4));
+                    if(std::memcmp(chunk, "fmt ", 4) == 0)
+                    {
+                        // The format chunk is 16, 18 or 40 bytes long (the extra bytes are ignored)
+                        std::array<unsigned char, 40> format;
+                        auto const formatSize = std::min(static_cast<size_t>(size), format.size());
+                        if(size < 16 || !mStream.read(reinterpret_cast<char*>(format.data()), static_cast<std::streamsize>(formatSize)))
+                        {
+                            error = "invalid format chunk";
+                            return false;
+                        }
+                        auto const remaining = static_cast<std::streamoff>(size - formatSize + (size & 1));
+                        if(remaining > 0 && !mStream.seekg(remaining, std::ios::cur))
+                        {
+                            error = "invalid format chunk";
+                            return false;
+                        }
+                        mFormat = static_cast<uint16_t>(getUnsigned(format.data(), 2));
+                        mNumChannels = static_cast<size_t>(getUnsigned(format.data() + 2, 2));
+                        mSampleRate = static_cast<double>(getUnsigned(format.data() + 4, 4));
+                        mBlockAlign = static_cast<size_t>(getUnsigned(format.data() + 12, 2));
+                        mBitsPerSample = static_cast<size_t>(getUnsigned(format.data() + 14, 2));
+                        if(mFormat == 0xFFFE && size >= 26)
+                        {
+                            // WAVE_FORMAT_EXTENSIBLE: the format is the first two bytes of the sub-format GUID
+                            mFormat = static_cast<uint16_t>(getUnsigned(format.data() + 24, 2));
+                        }
+                        hasFormat = true;
+                    }
+                    else if(std::memcmp(chunk, "data", 4) == 0)
+                    {
+                        if(!hasFormat)
+                        {
+                            error = "data chunk before format chunk";
+                            return false;
+                        }
+                        if(mNumChannels == 0 || mBlockAlign == 0 || mSampleRate <= 0.0)
+                        {
+                            error = "invalid format";
+                            return false;
+                        }
+                        auto const isPcm = mFormat == 1 && (mBitsPerSample == 8 || mBitsPerSample == 16 || mBitsPerSample == 24 || mBitsPerSample == 32);
+                        auto const isFloat = mFormat == 3 && (mBitsPerSample == 32 || mBitsPerSample == 64);
+                        if((!isPcm && !isFloat) || mBlockAlign != mNumChannels * mBitsPerSample / 8)
+                        {
+                            error = "unsupported sample format";
+                            return false;
+                        }
+                        mRemainingFrames = static_cast<size_t>(size) / mBlockAlign;
+                        mNumFrames = mRemainingFrames;
+                        return true;
+                    }
+                    else
+                    {
+                        mStream.seekg(static_cast<std::streamoff>(size + (size & 1)), std::ios::cur);
+                    }
+                }
+                error = "no data chunk";
+                return false;
+            }
+
+            // Reads up to numFrames mono samples and returns the number of samples read
+            size_t read(float* output, size_t numFrames)
+            {
+                numFrames = std::min(numFrames, mRemainingFrames);
+                mBytes.resize(numFrames * mBlockAlign);
+                mStream.read(reinterpret_cast<char*>(mBytes.data()), static_cast<std::streamsize>(mBytes.size()));
+                numFrames = static_cast<size_t>(mStream.gcount()) / mBlockAlign;
+                mRemainingFrames = mStream ? mRemainingFrames - numFrames : 0;
+
+                auto const sampleSize = mBitsPerSample / 8;
+                auto const gain = 1.0f / static_cast<float>(mNumChannels);
+                for(size_t frame = 0; frame < numFrames; ++frame)
+                {
+                    auto const* data = mBytes.data() + frame * mBlockAlign;
+                    auto sum = 0.0f;
+                    for(size_t channel = 0; channel < mNumChannels; ++channel)
+                    {
+                        sum += getSample(data + channel * sampleSize);
+                    }
+                    output[frame] = sum * gain;
+                }
+                return numFrames;
+            }
+
+            double getSampleRate() const noexcept
+            {
+                return mSampleRate;
+            }
+
+            size_t getNumFrames() const noexcept
+            {
+                return mNumFrames;
+            }
+
+        private:
+            static uint64_t getUnsigned(unsigned char const* data, size_t numBytes) noexcept
+            {
+                uint64_t value = 0;
+                for(size_t i = 0; i < numBytes; ++i)
+                {
+                    value |= static_cast<uint64_t>(data[i]) << (8 * i);
+                }
+                return value;
+            }
+
+            float getSample(unsigned char const* data) const noexcept
+            {
+                if(mFormat == 3)
+                {
+                    if(mBitsPerSample == 32)
+                    {
+                        auto const bits = static_cast<uint32_t>(getUnsigned(data, 4));
+                        float value;
+                        std::memcpy(&value, &bits, sizeof(value));
+                        return value;
+                    }
+                    auto const bits = getUnsigned(data, 8);
+                    double value;
+                    std::memcpy(&value, &bits, sizeof(value));
+                    return static_cast<float>(value);
+                }
+                switch(mBitsPerSample)
+                {
+                    case 8:
+                        return static_cast<float>(static_cast<int>(data[0]) - 128) / 128.0f;
+                    case 16:
+                        return static_cast<float>(static_cast<int16_t>(getUnsigned(data, 2))) / 32768.0f;
+                    case 24:
+                        return static_cast<float>(static_cast<int32_t>(static_cast<uint32_t>(getUnsigned(data, 3)) << 8) >> 8) / 8388608.0f;
+                    default:
+                        return static_cast<float>(static_cast<double>(static_cast<int32_t>(getUnsigned(data, 4))) / 2147483648.0);
+                }
+            }
+
+            std::ifstream mStream;
+            std::vector<unsigned char> mBytes;
+            uint16_t mFormat{0};
+            size_t mNumChannels{0};
+            size_t mBlockAlign{0};
+            size_t mBitsPerSample{0};
+            double mSampleRate{0.0};
+            size_t mNumFrames{0};
+            size_t mRemainingFrames{0};
+        };
+
+        // A queue per worker: each worker pops its own jobs from the front and steals the jobs of the others from the back
+        class WorkQueue
+        {
+        public:
+            WorkQueue(size_t numWorkers)
+            {
+                for(size_t i = 0; i < numWorkers; ++i)
+                {
+                    mQueues.push_back(std::make_unique<Queue>());
+                }
+            }
+
+            void push(size_t worker, size_t job)
+            {
+                auto& queue = *mQueues.at(worker % mQueues.size());
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                queue.jobs.push_back(job);
+            }
+
+            std::optional<size_t> pop(size_t worker)
+            {
+                {
+                    auto& queue = *mQueues.at(worker);
+                    std::lock_guard<std::mutex> lock(queue.mutex);
+                    if(!queue.jobs.empty())
+                    {
+                        auto const job = queue.jobs.front();
+                        queue.jobs.pop_front();
+                        return job;
+                    }
+                }
+                for(size_t i = 1; i < mQueues.size(); ++i)
+                {
+                    auto& queue = *mQueues.at((worker + i) % mQueues.size());
+                    std::lock_guard<std::mutex> lock(queue.mutex);
+                    if(!queue.jobs.empty())
+                    {
+                        auto const job = queue.jobs.back();
+                        queue.jobs.pop_back();
+                        return job;
+                    }
+                }
+                return std::nullopt;
+            }
+
+        private:
+            struct Queue
+            {
+                std::mutex mutex;
+                std::deque<size_t> jobs;
+            };
+
+            std::vector<std::unique_ptr<Queue>> mQueues;
+        };
+
+        enum class Format
+        {
+            json,
+            csv
+        };
+
+        struct Options
+        {
+            std::filesystem::path outputDirectory;
+            Format format{Format::json};
+            size_t numWorkers{std::max(std::thread::hardware_concurrency() / 4u, 1u)};
+            size_t blockSize{0};
+            std::vector<std::pair<std::string, float>> parameters;
+            std::vector<size_t> benchmarkTypes;
+        };
+
+        struct Job
+        {
+            std::filesystem::path input;
+            std::filesystem::path output;
+            uintmax_t size{0};
+        };
+
+        struct Result
+        {
+            bool succeeded{false};
+            std::string error;
+            double duration{0.0};
+            double processingTime{0.0};
+        };
+
+        // Returns the length of the valid UTF-8 sequence starting at the position or 0 if the sequence is invalid
+        static size_t getUtf8SequenceLength(std::string const& text, size_t position)
+        {
+            auto const getByte = [&](size_t index)
+            {
+                return index < text.size() ? static_cast<unsigned char>(text[index]) : 0u;
+            };
+            auto const isContinuation = [&](size_t index)
+            {
+                return (getByte(index) & 0xC0u) == 0x80u;
+            };
+            auto const lead = getByte(position);
+            if(lead < 0x80u)
+            {
+                return 1;
+            }
+            if(lead >= 0xC2u && lead <= 0xDFu)
+            {
+                return isContinuation(position + 1) ? 2 : 0;
+            }
+            if(lead >= 0xE0u && lead <= 0xEFu)
+            {
+                // Rejects the overlong sequences and the surrogates
+                auto const second = getByte(position + 1);
+                auto const isValidSecond = lead == 0xE0u ? second >= 0xA0u : (lead == 0xEDu ? second < 0xA0u : true);
+                return isContinuation(position + 1) && isValidSecond && isContinuation(position + 2) ? 3 : 0;
+            }
+            if(lead >= 0xF0u && lead <= 0xF4u)
+            {
+                // Rejects the overlong sequences and the code points above U+10FFFF
+                auto const second = getByte(position + 1);
+                auto const isValidSecond = lead == 0xF0u ? second >= 0x90u : (lead == 0xF4u ? second < 0x90u : true);
+                return isContinuation(position + 1) && isValidSecond && isContinuation(position + 2) && isContinuation(position + 3) ? 4 : 0;
+            }
+            return 0;
+        }
+
+        static std::string escape(std::string const& text, Format format)
+        {
+            std::ostringstream stream;
+            if(format == Format::csv)
+            {
+                for(auto const c : text)
+                {
+                    if(c == '"')
+                    {
+                        stream << "\"\"";
+                    }
+                    else
+                    {
+                        stream << c;
+                    }
+                }
+                return stream.str();
+            }
+
+            // The tokens can contain partial UTF-8 sequences that are replaced by U+FFFD to keep the JSON valid
+            size_t position = 0;
+            while(position < text.size())
+            {
+                auto const c = text[position];
+                auto const length = getUtf8SequenceLength(text, position);
+                if(length == 0)
+                {
+                    stream << "\\ufffd";
+                    ++position;
+                    continue;
+                }
+                if(length > 1)
+                {
+                    stream.write(text.data() + position, static_cast<std::streamsize>(length));
+                }
+                else if(c == '"' || c == '\\')
+                {
+                    stream << '\\' << c;
+                }
+                else if(c == '\n')
+                {
+                    stream << "\\n";
+                }
+                else if(c == '\t')
+                {
+                    stream << "\\t";
+                }
+                else if(static_cast<unsigned char>(c) < 0x20)
+                {
+                    stream << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec;
+                }
+                else
+                {
+                    stream << c;
+                }
+                position += length;
+            }
+            return stream.str();
+        }
+
+        static double toSeconds(Vamp::RealTime const& time)
+        {
+            return static_cast<double>(time.sec) + static_cast<double>(time.nsec) / 1000000000.0;
+        }
+
+        static bool write(Job const& job, Result const& result, Vamp::Plugin::FeatureList const& features, Format format)
+        {
+            std::error_code ec;
+            std::filesystem::create_directories(job.output.parent_path(), ec);
+            std::ofstream stream(job.output, std::ios::trunc);
+            if(!stream)
+            {
+                return false;
+            }
+            stream << std::setprecision(10);
+            if(format == Format::csv)
+            {
+                stream << "time,duration,label,probability\n";
+                for(auto const& feature : features)
+                {
+                    stream << toSeconds(feature.timestamp) << "," << toSeconds(feature.duration) << ",\"" << escape(feature.label, format) << "\"," << (feature.values.empty() ? 0.0f : feature.values.front()) << "\n";
+                }
+            }
+            else
+            {
+                stream << "{\n";
+                stream << "  \"file\": \"" << escape(job.input.string(), format) << "\",\n";
+                stream << "  \"duration\": " << result.duration << ",\n";
+                stream << "  \"features\": [";
+                for(size_t i = 0; i < features.size(); ++i)
+                {
+                    auto const& feature = features[i];
+                    stream << (i == 0 ? "\n" : ",\n");
+                    stream << "    {\"time\": " << toSeconds(feature.timestamp);
+                    stream << ", \"duration\": " << toSeconds(feature.duration);
+                    stream << ", \"label\": \"" << escape(feature.label, format) << "\"";
+                    stream << ", \"probability\": " << (feature.values.empty() ? 0.0f : feature.values.front()) << "}";
+                }
+                stream << (features.empty() ? "]\n" : "\n  ]\n");
+                stream << "}\n";
+            }
+            return static_cast<bool>(stream);
+        }
+
+        // Each worker owns one plugin instance (and so one whisper state) per sample rate,
+        // the model itself is shared by all the instances.
+        static bool transcribe(Wvp::Plugin& plugin, WavReader& reader, std::vector<float>& block, Vamp::Plugin::FeatureList& features, std::string& error)
+        {
+            auto const sampleRate = static_cast<int>(reader.getSampleRate());
+            float const* buffers[] = {block.data()};
+            size_t position = 0;
+            while(auto const numFrames = reader.read(block.data(), block.size()))
+            {
+                std::fill(block.begin() + static_cast<std::ptrdiff_t>(numFrames), block.end(), 0.0f);
+                auto fs = plugin.process(buffers, Vamp::RealTime::frame2RealTime(static_cast<long>(position), sampleRate));
+                auto& fl = fs[0];
+                features.insert(features.end(), std::make_move_iterator(fl.begin()), std::make_move_iterator(fl.end()));
+                position += numFrames;
+            }
+            if(position != reader.getNumFrames())
+            {
+                error = "truncated data chunk";
+                return false;
+            }
+            auto fs = plugin.getRemainingFeatures();
+            auto& fl = fs[0];
+            features.insert(features.end(), std::make_move_iterator(fl.begin()), std::make_move_iterator(fl.end()));
+            return true;
+        }
+
+        static std::unique_ptr<Wvp::Plugin> createPlugin(Options const& options, double sampleRate, std::vector<float>& block)
+        {
+            auto plugin = std::make_unique<Wvp::Plugin>(static_cast<float>(sampleRate));
+            for(auto const& parameter : options.parameters)
+            {
+                plugin->setParameter(parameter.first, parameter.second);
+            }
+            auto const blockSize = options.blockSize > 0 ? options.blockSize : plugin->getPreferredBlockSize();
+            if(!plugin->initialise(1, blockSize, blockSize))
+            {
+                return nullptr;
+            }
+            block.resize(blockSize);
+            return plugin;
+        }
+
+        class Worker
+        {
+        public:
+            Worker(Options const& options)
+            : mOptions(options)
+            {
+            }
+
+            Result process(Job const& job)
+            {
+                Result result;
+                auto const start = std::chrono::steady_clock::now();
+                WavReader reader;
+                if(!reader.open(job.input, result.error))
+                {
+                    return result;
+                }
+                auto* plugin = getPlugin(reader.getSampleRate(), result.error);
+                if(plugin == nullptr)
+                {
+                    return result;
+                }
+
+                Vamp::Plugin::FeatureList features;
+                if(!transcribe(*plugin, reader, mBlock, features, result.error))
+                {
+                    return result;
+                }
+
+                result.duration = static_cast<double>(reader.getNumFrames()) / reader.getSampleRate();
+                result.processingTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                if(!write(job, result, features, mOptions.format))
+                {
+                    result.error = "cannot write " + job.output.string();
+                    return result;
+                }
+                result.succeeded = true;
+                return result;
+            }
+
+        private:
+            Wvp::Plugin* getPlugin(double sampleRate, std::string& error)
+            {
+                auto it = mPlugins.find(sampleRate);
+                if(it != mPlugins.end())
+                {
+                    it->second->reset();
+                    return it->second.get();
+                }
+                auto plugin = createPlugin(mOptions, sampleRate, mBlock);
+                if(plugin == nullptr)
+                {
+                    error = "cannot initialise the plugin (invalid model)";
+                    return nullptr;
+                }
+                return mPlugins.emplace(sampleRate, std::move(plugin)).first->second.get();
+            }
+
+            Options const& mOptions;
+            std::map<double, std::unique_ptr<Wvp::Plugin>> mPlugins;
+            std::vector<float> mBlock;
+        };
+
+        static void printUsage()
+        {
+            std::cout << "Usage: wvp_batch [options] <file or directory>...\n"
+                      << "Transcribes WAV files with the Whisper Vamp plugin.\n\n"
+                      << "Options:\n"
+                      << "  -l, --list <file>          A text file containing one audio file per line\n"
+                      << "  -o, --output <directory>   The output directory (default: next to the audio files)\n"
+                      << "  -f, --format <json|csv>    The output format (default: json)\n"
+                      << "  -j, --jobs <number>        The number of files processed concurrently (default: " << Options{}.numWorkers << ")\n"
+                      << "  -b, --block-size <number>  The block size in samples (default: the preferred block size of the plugin)\n"
+                      << "  -p, --parameter <id=value> A parameter of the plugin (model, quantization, splitmode, suppressnonspeechtokens)\n"
+                      << "  -B, --benchmark <types>    Transcribes the files with each quantization type of the comma-separated list\n"
+                      << "                             (none, q8_0, q5_1, q5_0, q4_1, q4_0) and reports the memory and the real-time factor\n"
+                      << "                             without writing the results\n"
+                      << "  -h, --help                 Prints this message\n";
+        }
+
+        static bool parseNumber(std::string const& text, size_t& value)
+        {
+            char* end = nullptr;
+            auto const result = std::strtoul(text.c_str(), &end, 10);
+            if(text.empty() || end == nullptr || *end != '\0' || result == 0)
+            {
+                return false;
+            }
+            value = static_cast<size_t>(result);
+            return true;
+        }
+
+        static bool parseParameter(std::string const& text, std::pair<std::string, float>& parameter)
+        {
+            auto const separator = text.find('=');
+            if(separator == std::string::npos || separator == 0)
+            {
+                return false;
+            }
+            auto const value = text.substr(separator + 1);
+            char* end = nullptr;
+            parameter.first = text.substr(0, separator);
+            parameter.second = std::strtof(value.c_str(), &end);
+            return !value.empty() && end != nullptr && *end == '\0';
+        }
+
+        static void addInput(std::filesystem::path const& input, std::vector<Job>& jobs)
+        {
+            auto const addJob = [&](std::filesystem::path const& path)
+            {
+                Job job;
+                job.input = path;
+                std::error_code ec;
+                job.size = std::filesystem::file_size(path, ec);
+                jobs.push_back(std::move(job));
+            };
+
+            if(!std::filesystem::is_directory(input))
+            {
+                addJob(input);
+                return;
+            }
+            std::error_code ec;
+            for(auto const& entry : std::filesystem::recursive_directory_iterator(input, ec))
+            {
+                auto extensionName = entry.path().extension().string();
+                std::transform(extensionName.begin(), extensionName.end(), extensionName.begin(), [](char c)
+                               {
+                                   return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+                               });
+                if(entry.is_regular_file() && (extensionName == ".wav" || extensionName == ".wave"))
+                {
+                    addJob(entry.path());
+                }
+            }
+        }
+
+        static std::filesystem::path getCommonDirectory(std::vector<std::filesystem::path> const& paths)
+        {
+            if(paths.empty())
+            {
+                return {};
+            }
+            auto common = paths.front().parent_path();
+            for(auto const& path : paths)
+            {
+                auto const directory = path.parent_path();
+                while(!common.empty())
+                {
+                    auto const result = std::mismatch(common.begin(), common.end(), directory.begin(), directory.end());
+                    if(result.first == common.end())
+                    {
+                        break;
+                    }
+                    common = common.has_relative_path() ? common.parent_path() : std::filesystem::path{};
+                }
+            }
+            return common;
+        }
+
+        // The directory structure of the inputs is kept (relatively to their common directory) in the output directory,
+        // so the results of inputs with the same file name don't overwrite each other.
+        static bool setOutputs(std::vector<Job>& jobs, std::filesystem::path const& outputDirectory, Format format, std::string& error)
+        {
+            std::vector<std::filesystem::path> inputs;
+            for(auto const& job : jobs)
+            {
+                inputs.push_back(std::filesystem::absolute(job.input).lexically_normal());
+            }
+            auto const common = getCommonDirectory(inputs);
+            std::map<std::filesystem::path, size_t> outputs;
+            for(size_t i = 0; i < jobs.size(); ++i)
+            {
+                auto& job = jobs[i];
+                if(outputDirectory.empty())
+                {
+                    job.output = inputs[i];
+                }
+                else
+                {
+                    auto const relativePath = common.empty() ? inputs[i].relative_path() : inputs[i].lexically_relative(common);
+                    job.output = std::filesystem::absolute(outputDirectory / relativePath).lexically_normal();
+                }
+                job.output.replace_extension(format == Format::csv ? ".csv" : ".json");
+                auto const result = outputs.emplace(job.output, i);
+                if(!result.second)
+                {
+                    error = "the results of " + jobs[result.first->second].input.string() + " and " + job.input.string() + " would be written to the same file " + job.output.string();
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // The resident memory of the process in bytes (0 if not available)
+        static size_t getResidentMemory()
+        {
+#if defined(_WIN32)
+            PROCESS_MEMORY_COUNTERS counters;
+            if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+            {
+                return static_cast<size_t>(counters.WorkingSetSize);
+            }
+            return 0;
+#elif defined(__APPLE__)
+            mach_task_basic_info info;
+            mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+            if(task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) == KERN_SUCCESS)
+            {
+                return static_cast<size_t>(info.resident_size);
+            }
+            return 0;
+#else
+            std::ifstream stream("/proc/self/statm");
+            size_t size, resident;
+            if(stream >> size >> resident)
+            {
+                return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            }
+            return 0;
+#endif
+        }
+
+        static bool parseTypes(std::string const& text, std::vector<size_t>& types)
+        {
+            auto const names = Wvp::Quantizer::getTypeNames();
+            std::istringstream stream(text);
+            std::string name;
+            while(std::getline(stream, name, ','))
+            {
+                auto const it = std::find(names.cbegin(), names.cend(), name);
+                if(it == names.cend())
+                {
+                    return false;
+                }
+                types.push_back(static_cast<size_t>(std::distance(names.cbegin(), it)));
+            }
+            return !types.empty();
+        }
+
+        // Transcribes the files with each quantization type one after the other, the cached quantized models are
+        // generated before the measurements so the load time and the memory only concern the quantized models.
+        static bool benchmark(Options const& options, std::vector<Job> const& jobs)
+        {
+            auto const toMegaBytes = [](size_t before, size_t after)
+            {
+                return after > before ? static_cast<double>(after - before) / (1024.0 * 1024.0) : 0.0;
+            };
+            auto const names = Wvp::Quantizer::getTypeNames();
+            std::cout << std::left << std::setw(14) << "Quantization" << std::right << std::setw(12) << "Load (s)" << std::setw(14) << "Model (MB)" << std::setw(16) << "Resident (MB)" << std::setw(12) << "Audio (s)" << std::setw(16) << "Processing (s)" << std::setw(8) << "RTF" << std::setw(10) << "Features" << "\n";
+            auto succeeded = true;
+            for(auto const type : options.benchmarkTypes)
+            {
+                auto typeOptions = options;
+                typeOptions.parameters.emplace_back("quantization", static_cast<float>(type));
+                std::vector<float> block;
+                std::string error;
+
+                // Generates the quantized model if necessary
+                WavReader reader;
+                if(!reader.open(jobs.front().input, error))
+                {
+                    std::cerr << names.at(type) << ": " << jobs.front().input.string() << " failed: " << error << "\n";
+                    succeeded = false;
+                    continue;
+                }
+                auto const modelIndex = [&]()
+                {
+                    auto const plugin = createPlugin(typeOptions, reader.getSampleRate(), block);
+                    return plugin == nullptr ? std::optional<size_t>{} : static_cast<size_t>(plugin->getParameter("model"));
+                }();
+                if(!modelIndex.has_value())
+                {
+                    std::cerr << names.at(type) << ": cannot initialise the plugin\n";
+                    succeeded = false;
+                    continue;
+                }
+                // The plugin falls back to the source model if it cannot be quantized
+                if(type != 0)
+                {
+                    auto const models = Wvp::getModelPaths();
+                    if(*modelIndex == 0 || *modelIndex > models.size())
+                    {
+                        std::cerr << names.at(type) << ": failed: the embedded model cannot be quantized, use --parameter model=<index>\n";
+                        succeeded = false;
+                        continue;
+                    }
+                    auto const& source = models.at(*modelIndex - 1);
+                    if(!Wvp::Quantizer::isCached(source, Wvp::getCacheDirectory(), static_cast<Wvp::Quantizer::Type>(type)))
+                    {
+                        std::cerr << names.at(type) << ": failed: " << source.filename().string() << " cannot be quantized to " << names.at(type) << "\n";
+                        succeeded = false;
+                        continue;
+                    }
+                }
+
+                auto const initialMemory = getResidentMemory();
+                auto const loadStart = std::chrono::steady_clock::now();
+                std::map<double, std::unique_ptr<Wvp::Plugin>> plugins;
+                auto& plugin = plugins[reader.getSampleRate()];
+                plugin = createPlugin(typeOptions, reader.getSampleRate(), block);
+                auto const loadTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - loadStart).count();
+                auto const modelMemory = getResidentMemory();
+
+                auto duration = 0.0;
+                auto processingTime = 0.0;
+                size_t numFeatures = 0;
+                for(auto const& job : jobs)
+                {
+                    WavReader jobReader;
+                    if(!jobReader.open(job.input, error))
+                    {
+                        std::cerr << names.at(type) << ": " << job.input.string() << " failed: " << error << "\n";
+                        succeeded = false;
+                        continue;
+                    }
+                    auto& jobPlugin = plugins[jobReader.getSampleRate()];
+                    if(jobPlugin == nullptr)
+                    {
+                        jobPlugin = createPlugin(typeOptions, jobReader.getSampleRate(), block);
+                    }
+                    else
+                    {
+                        jobPlugin->reset();
+                    }
+                    Vamp::Plugin::FeatureList features;
+                    auto const start = std::chrono::steady_clock::now();
+                    if(jobPlugin == nullptr || !transcribe(*jobPlugin, jobReader, block, features, error))
+                    {
+                        std::cerr << names.at(type) << ": " << job.input.string() << " failed: " << (jobPlugin == nullptr ? "cannot initialise the plugin" : error) << "\n";
+                        succeeded = false;
+                        continue;
+                    }
+                    processingTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                    duration += static_cast<double>(jobReader.getNumFrames()) / jobReader.getSampleRate();
+                    numFeatures += features.size();
+                }
+                auto const residentMemory = getResidentMemory();
+
+                std::cout << std::fixed << std::setprecision(2);
+                std::cout << std::left << std::setw(14) << names.at(type) << std::right << std::setw(12) << loadTime << std::setw(14) << toMegaBytes(initialMemory, modelMemory) << std::setw(16) << toMegaBytes(0, residentMemory) << std::setw(12) << duration << std::setw(16) << processingTime << std::setw(8) << (duration > 0.0 ? processingTime / duration : 0.0) << std::setw(10) << numFeatures << "\n";
+            }
+            return succeeded;
+        }
+    } // namespace Batch
+} // namespace Wvp
+
+int main(int argc, char* argv[])
+{
+    using namespace Wvp::Batch;
+
+    Options options;
+    std::vector<std::filesystem::path> inputs;
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string const arg = argv[i];
+        auto const hasValue = i + 1 < argc;
+        if(arg == "-h" || arg == "--help")
+        {
+            printUsage();
+            return EXIT_SUCCESS;
+        }
+        else if((arg == "-l" || arg == "--list") && hasValue)
+        {
+            std::ifstream list(argv[++i]);
+            if(!list)
+            {
+                std::cerr << "Cannot open the list " << argv[i] << "\n";
+                return EXIT_FAILURE;
+            }
+            std::string line;
+            while(std::getline(list, line))
+            {
+                if(!line.empty() && line.back() == '\r')
+                {
+                    line.pop_back();
+                }
+                if(!line.empty())
+                {
+                    inputs.push_back(line);
+                }
+            }
+        }
+        else if((arg == "-o" || arg == "--output") && hasValue)
+        {
+            options.outputDirectory = argv[++i];
+        }
+        else if((arg == "-f" || arg == "--format") && hasValue)
+        {
+            std::string const format = argv[++i];
+            if(format != "json" && format != "csv")
+            {
+                std::cerr << "Invalid format " << format << "\n";
+                return EXIT_FAILURE;
+            }
+            options.format = format == "csv" ? Format::csv : Format::json;
+        }
+        else if((arg == "-j" || arg == "--jobs") && hasValue)
+        {
+            if(!parseNumber(argv[++i], options.numWorkers))
+            {
+                std::cerr << "Invalid number of jobs " << argv[i] << "\n";
+                return EXIT_FAILURE;
+            }
+        }
+        else if((arg == "-b" || arg == "--block-size") && hasValue)
+        {
+            if(!parseNumber(argv[++i], options.blockSize))
+            {
+                std::cerr << "Invalid block size " << argv[i] << "\n";
+                return EXIT_FAILURE;
+            }
+        }
+        else if((arg == "-p" || arg == "--parameter") && hasValue)
+        {
+            std::pair<std::string, float> parameter;
+            if(!parseParameter(argv[++i], parameter))
+            {
+                std::cerr << "Invalid parameter " << argv[i] << "\n";
+                return EXIT_FAILURE;
+            }
+            options.parameters.push_back(std::move(parameter));
+        }
+        else if((arg == "-B" || arg == "--benchmark") && hasValue)
+        {
+            if(!parseTypes(argv[++i], options.benchmarkTypes))
+            {
+                std::cerr << "Invalid quantization types " << argv[i] << "\n";
+                return EXIT_FAILURE;
+            }
+        }
+        else if(!arg.empty() && arg.front() == '-')
+        {
+            std::cerr << "Invalid argument " << arg << "\n";
+            printUsage();
+            return EXIT_FAILURE;
+        }
+        else
+        {
+            inputs.push_back(arg);
+        }
+    }
+
+    std::vector<Job> jobs;
+    for(auto const& input : inputs)
+    {
+        addInput(input, jobs);
+    }
+    if(jobs.empty())
+    {
+        std::cerr << "No audio file to process\n";
+        printUsage();
+        return EXIT_FAILURE;
+    }
+    if(!options.benchmarkTypes.empty())
+    {
+        return benchmark(options, jobs) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    std::string error;
+    if(!setOutputs(jobs, options.outputDirectory, options.format, error))
+    {
+        std::cerr << "Invalid outputs: " << error << "\n";
+        return EXIT_FAILURE;
+    }
+
+    // The largest files are dispatched first to balance the end of the processing
+    std::vector<size_t> order(jobs.size());
+    for(size_t i = 0; i < order.size(); ++i)
+    {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs)
+                     {
+                         return jobs[lhs].size > jobs[rhs].size;
+                     });
+    auto const numWorkers = std::min(options.numWorkers, jobs.size());
+    WorkQueue queue(numWorkers);
+    for(size_t i = 0; i < order.size(); ++i)
+    {
+        queue.push(i, order[i]);
+    }
+
+    std::vector<Result> results(jobs.size());
+    std::atomic<size_t> numProcessed{0};
+    std::mutex printMutex;
+    auto const start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for(size_t i = 0; i < numWorkers; ++i)
+    {
+        threads.emplace_back([&, i]()
+                             {
+                                 Worker worker(options);
+                                 while(auto const index = queue.pop(i))
+                                 {
+                                     auto const& job = jobs.at(*index);
+                                     Result result;
+                                     try
+                                     {
+                                         result = worker.process(job);
+                                     }
+                                     catch(std::exception const& e)
+                                     {
+                                         result.succeeded = false;
+                                         result.error = e.what();
+                                     }
+                                     catch(...)
+                                     {
+                                         result.succeeded = false;
+                                         result.error = "unknown error";
+                                     }
+                                     auto const count = ++numProcessed;
+                                     {
+                                         std::lock_guard<std::mutex> lock(printMutex);
+                                         std::cerr << "[" << count << "/" << jobs.size() << "] " << job.input.string();
+                                         if(result.succeeded)
+                                         {
+                                             auto const rtf = result.duration > 0.0 ? result.processingTime / result.duration : 0.0;
+                                             std::cerr << std::fixed << std::setprecision(2) << " (" << result.duration << " s, RTF " << rtf << ")\n";
+                                         }
+                                         else
+                                         {
+                                             std::cerr << " failed: " << result.error << "\n";
+                                         }
+                                     }
+                                     results.at(*index) = result;
+                                 }
+                             });
+    }
+    for(auto& thread : threads)
+    {
+        thread.join();
+    }
+    auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t numFailures = 0;
+    auto totalDuration = 0.0;
+    for(auto const& result : results)
+    {
+        numFailures += result.succeeded ? 0 : 1;
+        totalDuration += result.duration;
+    }
+    std::cerr << std::fixed << std::setprecision(2);
+    std::cerr << "Processed " << jobs.size() << " files (" << numFailures << " failed) with " << numWorkers << " workers: ";
+    std::cerr << totalDuration << " s of audio in " << elapsed << " s (" << (elapsed > 0.0 ? totalDuration / elapsed : 0.0) << "x real time)\n";
+    for(size_t i = 0; i < jobs.size(); ++i)
+    {
+        if(!results[i].succeeded)
+        {
+            std::cerr << "Failed: " << jobs[i].input.string() << " (" << results[i].error << ")\n";
+        }
+    }
+    return numFailures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
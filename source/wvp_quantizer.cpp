@@ -0,0 +1,540 @@
+#include "wvp_quantizer.h"
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <ggml.h>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+namespace Wvp
+{
+    namespace Quantizer
+    {
+        static auto constexpr gCacheVersion = 1;
+        static auto constexpr gModelMagic = static_cast<uint32_t>(0x67676d6c);
+
+        static std::string getTypeName(Type type)
+        {
+            auto const names = getTypeNames();
+            return names.at(static_cast<size_t>(type));
+        }
+
+        static ggml_type getGgmlType(Type type)
+        {
+            switch(type)
+            {
+                case Type::q8_0:
+                    return GGML_TYPE_Q8_0;
+                case Type::q5_1:
+                    return GGML_TYPE_Q5_1;
+                case Type::q5_0:
+                    return GGML_TYPE_Q5_0;
+                case Type::q4_1:
+                    return GGML_TYPE_Q4_1;
+                case Type::q4_0:
+                    return GGML_TYPE_Q4_0;
+                case Type::none:
+                    break;
+            }
+            return GGML_TYPE_F32;
+        }
+
+        static ggml_ftype getGgmlFileType(Type type)
+        {
+            switch(type)
+            {
+                case Type::q8_0:
+                    return GGML_FTYPE_MOSTLY_Q8_0;
+                case Type::q5_1:
+                    return GGML_FTYPE_MOSTLY_Q5_1;
+                case Type::q5_0:
+                    return GGML_FTYPE_MOSTLY_Q5_0;
+                case Type::q4_1:
+                    return GGML_FTYPE_MOSTLY_Q4_1;
+                case Type::q4_0:
+                    return GGML_FTYPE_MOSTLY_Q4_0;
+                case Type::none:
+                    break;
+            }
+            return GGML_FTYPE_ALL_F32;
+        }
+
+        template <typename T>
+        static bool read(std::ifstream& stream, T& value)
+        {
+            return static_cast<bool>(stream.read(reinterpret_cast<char*>(&value), sizeof(T)));
+        }
+
+        template <typename T>
+        static void write(std::ofstream& stream, T const& value)
+        {
+            stream.write(reinterpret_cast<char const*>(&value), sizeof(T));
+        }
+
+        static bool copy(std::ifstream& input, std::ofstream& output, size_t size, std::vector<char>& buffer)
+        {
+            buffer.resize(size);
+            if(!input.read(buffer.data(), static_cast<std::streamsize>(size)))
+            {
+                return false;
+            }
+            output.write(buffer.data(), static_cast<std::streamsize>(size));
+            return static_cast<bool>(output);
+        }
+
+        static bool isQuantizable(std::filesystem::path const& path)
+        {
+            std::ifstream input(path, std::ios::binary);
+            uint32_t magic;
+            if(!read(input, magic) || magic != gModelMagic)
+            {
+                return false;
+            }
+            std::array<int32_t, 11> hparams;
+            for(auto& hparam : hparams)
+            {
+                if(!read(input, hparam))
+                {
+                    return false;
+                }
+            }
+            auto const itype = hparams.back() % GGML_QNT_VERSION_FACTOR;
+            return itype == GGML_FTYPE_ALL_F32 || itype == GGML_FTYPE_MOSTLY_F16;
+        }
+
+        // Returns the type of a tensor in the quantized model
+        static ggml_type getTensorType(std::string const& name, int32_t nDims, int32_t ttype, ggml_type type)
+        {
+            // Same tensors as the quantize example of whisper.cpp
+            static std::array<std::string, 4> const skipped{"encoder.conv1.bias", "encoder.conv2.bias", "encoder.positional_embedding", "decoder.positional_embedding"};
+            if(std::find(skipped.cbegin(), skipped.cend(), name) != skipped.cend() || (ttype != GGML_TYPE_F32 && ttype != GGML_TYPE_F16))
+            {
+                return static_cast<ggml_type>(ttype);
+            }
+            if(nDims == 2)
+            {
+                return type;
+            }
+            // The loader expects half precision convolution kernels in quantized models
+            if(nDims == 3)
+            {
+                return GGML_TYPE_F16;
+            }
+            return static_cast<ggml_type>(ttype);
+        }
+
+        static bool quantize(std::filesystem::path const& source, std::filesystem::path const& destination, Type type)
+        {
+            std::ifstream input(source, std::ios::binary);
+            std::ofstream output(destination, std::ios::binary | std::ios::trunc);
+            if(!input || !output)
+            {
+                std::cerr << "Whisper: failed to open " << source.string() << " or " << destination.string() << "\n";
+                return false;
+            }
+
+            uint32_t magic;
+            if(!read(input, magic) || magic != gModelMagic)
+            {
+                std::cerr << "Whisper: invalid model " << source.string() << "\n";
+                return false;
+            }
+            write(output, magic);
+
+            // n_vocab, n_audio_ctx, n_audio_state, n_audio_head, n_audio_layer, n_text_ctx, n_text_state, n_text_head, n_text_layer, n_mels, ftype
+            std::array<int32_t, 11> hparams;
+            for(auto& hparam : hparams)
+            {
+                if(!read(input, hparam))
+                {
+                    std::cerr << "Whisper: invalid model " << source.string() << "\n";
+                    return false;
+                }
+            }
+            hparams.back() = GGML_QNT_VERSION * GGML_QNT_VERSION_FACTOR + static_cast<int32_t>(getGgmlFileType(type));
+            for(auto const& hparam : hparams)
+            {
+                write(output, hparam);
+            }
+
+            std::vector<char> buffer;
+            // Mel filters
+            {
+                int32_t nMel, nFft;
+                if(!read(input, nMel) || !read(input, nFft))
+                {
+                    std::cerr << "Whisper: invalid model " << source.string() << "\n";
+                    return false;
+                }
+                write(output, nMel);
+                write(output, nFft);
+                if(!copy(input, output, static_cast<size_t>(nMel) * static_cast<size_t>(nFft) * sizeof(float), buffer))
+                {
+                    std::cerr << "Whisper: invalid model " << source.string() << "\n";
+                    return false;
+                }
+            }
+            // Vocabulary
+            {
+                int32_t nVocab;
+                if(!read(input, nVocab))
+                {
+                    std::cerr << "Whisper: invalid model " << source.string() << "\n";
+                    return false;
+                }
+                write(output, nVocab);
+                for(int32_t i = 0; i < nVocab; ++i)
+                {
+                    uint32_t length;
+                    if(!read(input, length))
+                    {
+                        std::cerr << "Whisper: invalid model " << source.string() << "\n";
+                        return false;
+                    }
+                    write(output, length);
+                    if(!copy(input, output, static_cast<size_t>(length), buffer))
+                    {
+                        std::cerr << "Whisper: invalid model " << source.string() << "\n";
+                        return false;
+                    }
+                }
+            }
+            // Tensors
+            auto const qtype = getGgmlType(type);
+            ggml_quantize_init(qtype);
+            std::vector<float> values;
+            std::vector<char> quantized;
+            while(true)
+            {
+                int32_t nDims, length, ttype;
+                if(!read(input, nDims))
+                {
+                    break;
+                }
+                if(!read(input, length) || !read(input, ttype) || nDims < 1 || nDims > 4 || ttype < 0 || ttype >= GGML_TYPE_COUNT)
+                {
+                    std::cerr << "Whisper: invalid model " << source.string() << "\n";
+                    return false;
+                }
+                std::array<int32_t, 4> ne{1, 1, 1, 1};
+                size_t nElements = 1;
+                for(int32_t i = 0; i < nDims; ++i)
+                {
+                    if(!read(input, ne[static_cast<size_t>(i)]))
+                    {
+                        std::cerr << "Whisper: invalid model " << source.string() << "\n";
+                        return false;
+                    }
+                    nElements *= static_cast<size_t>(ne[static_cast<size_t>(i)]);
+                }
+                std::string name(static_cast<size_t>(length), '\0');
+                if(!input.read(name.data(), static_cast<std::streamsize>(length)))
+                {
+                    std::cerr << "Whisper: invalid model " << source.string() << "\n";
+                    return false;
+                }
+
+                auto const otype = getTensorType(name, nDims, ttype, qtype);
+                if(otype == qtype && ne[0] % ggml_blck_size(qtype) != 0)
+                {
+                    std::cerr << "Whisper: cannot quantize tensor " << name << " of model " << source.string() << "\n";
+                    return false;
+                }
+                write(output, nDims);
+                write(output, length);
+                write(output, static_cast<int32_t>(otype));
+                for(int32_t i = 0; i < nDims; ++i)
+                {
+                    write(output, ne[static_cast<size_t>(i)]);
+                }
+                output.write(name.data(), static_cast<std::streamsize>(length));
+
+                auto const dataSize = nElements * ggml_type_size(static_cast<ggml_type>(ttype)) / static_cast<size_t>(ggml_blck_size(static_cast<ggml_type>(ttype)));
+                if(otype == ttype)
+                {
+                    if(!copy(input, output, dataSize, buffer))
+                    {
+                        std::cerr << "Whisper: invalid model " << source.string() << "\n";
+                        return false;
+                    }
+                    continue;
+                }
+
+                values.resize(nElements);
+                if(ttype == GGML_TYPE_F16)
+                {
+                    buffer.resize(dataSize);
+                    if(!input.read(buffer.data(), static_cast<std::streamsize>(dataSize)))
+                    {
+                        std::cerr << "Whisper: invalid model " << source.string() << "\n";
+                        return false;
+                    }
+                    ggml_fp16_to_fp32_row(reinterpret_cast<ggml_fp16_t const*>(buffer.data()), values.data(), static_cast<int64_t>(nElements));
+                }
+                else if(!input.read(reinterpret_cast<char*>(values.data()), static_cast<std::streamsize>(dataSize)))
+                {
+                    std::cerr << "Whisper: invalid model " << source.string() << "\n";
+                    return false;
+                }
+                if(otype == GGML_TYPE_F16)
+                {
+                    buffer.resize(nElements * sizeof(ggml_fp16_t));
+                    ggml_fp32_to_fp16_row(values.data(), reinterpret_cast<ggml_fp16_t*>(buffer.data()), static_cast<int64_t>(nElements));
+                    output.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+                    continue;
+                }
+                auto const nRows = static_cast<int64_t>(nElements) / ne[0];
+                quantized.resize(ggml_row_size(qtype, ne[0]) * static_cast<size_t>(nRows));
+                auto const size = ggml_quantize_chunk(qtype, values.data(), quantized.data(), 0, nRows, ne[0], nullptr);
+                output.write(quantized.data(), static_cast<std::streamsize>(size));
+            }
+            output.flush();
+            if(!output)
+            {
+                std::cerr << "Whisper: failed to write " << destination.string() << "\n";
+                return false;
+            }
+            return true;
+        }
+
+        static uint64_t getHash(char const* data, size_t size, uint64_t hash)
+        {
+            for(size_t i = 0; i < size; ++i)
+            {
+                hash ^= static_cast<uint64_t>(static_cast<unsigned char>(data[i]));
+                hash *= static_cast<uint64_t>(1099511628211ull);
+            }
+            return hash;
+        }
+
+        static auto constexpr gHashOffset = static_cast<uint64_t>(14695981039346656037ull);
+
+        // The size and the modification time are used as a cheap key before hashing the whole file
+        struct FileInfo
+        {
+            uintmax_t size{0};
+            int64_t time{0};
+            uint64_t hash{0};
+        };
+
+        static bool getFileKey(std::filesystem::path const& path, FileInfo& info)
+        {
+            std::error_code ec;
+            info.size = std::filesystem::file_size(path, ec);
+            if(ec)
+            {
+                return false;
+            }
+            auto const time = std::filesystem::last_write_time(path, ec);
+            if(ec)
+            {
+                return false;
+            }
+            info.time = static_cast<int64_t>(time.time_since_epoch().count());
+            return true;
+        }
+
+        // Returns true if the file still matches the info (the info is updated if the file has been touched but not modified)
+        static bool checkFile(std::filesystem::path const& path, FileInfo& info, bool& updated)
+        {
+            FileInfo current;
+            if(!getFileKey(path, current))
+            {
+                return false;
+            }
+            if(current.size == info.size && current.time == info.time)
+            {
+                return true;
+            }
+            if(current.size != info.size || Wvp::Quantizer::getHash(path) != info.hash)
+            {
+                return false;
+            }
+            info.time = current.time;
+            updated = true;
+            return true;
+        }
+
+        struct CacheInfo
+        {
+            int version{0};
+            int qntVersion{0};
+            FileInfo source;
+            FileInfo model;
+        };
+
+        static std::filesystem::path getTemporaryPath(std::filesystem::path const& path)
+        {
+            std::random_device device;
+            std::ostringstream suffix;
+            suffix << "." << std::hex << device() << device() << ".tmp";
+            auto temporary = path;
+            temporary += suffix.str();
+            return temporary;
+        }
+
+        static bool readCacheInfo(std::filesystem::path const& path, CacheInfo& info)
+        {
+            std::ifstream stream(path);
+            stream >> info.version >> info.qntVersion;
+            stream >> info.source.size >> info.source.time >> std::hex >> info.source.hash >> std::dec;
+            stream >> info.model.size >> info.model.time >> std::hex >> info.model.hash;
+            return static_cast<bool>(stream);
+        }
+
+        static bool writeCacheInfo(std::filesystem::path const& path, CacheInfo const& info)
+        {
+            auto const temporary = getTemporaryPath(path);
+            {
+                std::ofstream stream(temporary, std::ios::trunc);
+                stream << info.version << "\n"
+                       << info.qntVersion << "\n";
+                stream << info.source.size << " " << info.source.time << " " << std::hex << info.source.hash << std::dec << "\n";
+                stream << info.model.size << " " << info.model.time << " " << std::hex << info.model.hash << std::dec << "\n";
+                if(!stream)
+                {
+                    return false;
+                }
+            }
+            std::error_code ec;
+            std::filesystem::rename(temporary, path, ec);
+            if(ec)
+            {
+                std::filesystem::remove(temporary, ec);
+                return false;
+            }
+            return true;
+        }
+
+        static bool isValid(std::filesystem::path const& source, std::filesystem::path const& model, std::filesystem::path const& infoPath)
+        {
+            CacheInfo info;
+            if(!std::filesystem::exists(model) || !readCacheInfo(infoPath, info))
+            {
+                return false;
+            }
+            if(info.version != gCacheVersion || info.qntVersion != GGML_QNT_VERSION)
+            {
+                return false;
+            }
+            auto updated = false;
+            if(!checkFile(source, info.source, updated) || !checkFile(model, info.model, updated))
+            {
+                return false;
+            }
+            if(updated)
+            {
+                writeCacheInfo(infoPath, info);
+            }
+            return true;
+        }
+    } // namespace Quantizer
+} // namespace Wvp
+
+std::vector<std::string> Wvp::Quantizer::getTypeNames()
+{
+    return {"none", "q8_0", "q5_1", "q5_0", "q4_1", "q4_0"};
+}
+
+uint64_t Wvp::Quantizer::getHash(std::filesystem::path const& path)
+{
+    std::ifstream stream(path, std::ios::binary);
+    if(!stream)
+    {
+        return 0;
+    }
+    auto hash = gHashOffset;
+    std::vector<char> buffer(static_cast<size_t>(1) << 20);
+    while(stream)
+    {
+        stream.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        hash = getHash(buffer.data(), static_cast<size_t>(stream.gcount()), hash);
+    }
+    return hash;
+}
+
+std::filesystem::path Wvp::Quantizer::getCachePath(std::filesystem::path const& source, std::filesystem::path const& cacheDirectory, Type type)
+{
+    // The hash of the source path prevents models with the same name in different directories from sharing the same cache
+    auto const sourcePath = std::filesystem::absolute(source).lexically_normal().string();
+    std::ostringstream name;
+    name << source.stem().string() << "-" << std::hex << std::setw(16) << std::setfill('0') << getHash(sourcePath.data(), sourcePath.size(), gHashOffset) << "-" << getTypeName(type) << ".bin";
+    return cacheDirectory / ("v" + std::to_string(gCacheVersion)) / name.str();
+}
+
+bool Wvp::Quantizer::isCached(std::filesystem::path const& source, std::filesystem::path const& cacheDirectory, Type type)
+{
+    if(type == Type::none || cacheDirectory.empty())
+    {
+        return false;
+    }
+    auto const model = getCachePath(source, cacheDirectory, type);
+    return isValid(source, model, std::filesystem::path(model).replace_extension(".hash"));
+}
+
+std::filesystem::path Wvp::Quantizer::getModel(std::filesystem::path const& source, std::filesystem::path const& cacheDirectory, Type type)
+{
+    if(type == Type::none || cacheDirectory.empty() || !isQuantizable(source))
+    {
+        return source;
+    }
+    auto const model = getCachePath(source, cacheDirectory, type);
+    auto const infoPath = std::filesystem::path(model).replace_extension(".hash");
+    if(isValid(source, model, infoPath))
+    {
+        return model;
+    }
+    if(std::filesystem::exists(model))
+    {
+        std::cerr << "Whisper: invalid cached model " << model.string() << "\n";
+    }
+
+    CacheInfo info;
+    info.version = gCacheVersion;
+    info.qntVersion = GGML_QNT_VERSION;
+    if(!getFileKey(source, info.source))
+    {
+        std::cerr << "Whisper: failed to access " << source.string() << "\n";
+        return source;
+    }
+    info.source.hash = getHash(source);
+
+    std::error_code ec;
+    std::filesystem::create_directories(model.parent_path(), ec);
+    if(ec)
+    {
+        std::cerr << "Whisper: failed to create cache directory " << model.parent_path().string() << " (" << ec.message() << ")\n";
+        return source;
+    }
+    // The temporary file is unique so several processes can quantize the same model at the same time
+    auto const temporary = getTemporaryPath(model);
+    if(!quantize(source, temporary, type))
+    {
+        std::filesystem::remove(temporary, ec);
+        return source;
+    }
+    info.model.hash = getHash(temporary);
+    std::filesystem::rename(temporary, model, ec);
+    if(ec || !getFileKey(model, info.model))
+    {
+        std::cerr << "Whisper: failed to create cached model " << model.string() << " (" << ec.message() << ")\n";
+        std::filesystem::remove(temporary, ec);
+        return source;
+    }
+    if(!writeCacheInfo(infoPath, info))
+    {
+        std::cerr << "Whisper: failed to write " << infoPath.string() << "\n";
+    }
+
+    auto const toMegaBytes = [](uintmax_t size)
+    {
+        return static_cast<double>(size) / (1024.0 * 1024.0);
+    };
+    std::ostringstream summary;
+    summary.precision(1);
+    summary << std::fixed << "Whisper: quantized model " << source.filename().string() << " to " << getTypeName(type) << " (" << toMegaBytes(info.source.size) << " MB -> " << toMegaBytes(info.model.size) << " MB)\n";
+    std::cerr << summary.str();
+    return model;
+}
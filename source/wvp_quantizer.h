@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace Wvp
+{
+    namespace Quantizer
+    {
+        enum class Type
+        {
+            none,
+            q8_0,
+            q5_1,
+            q5_0,
+            q4_1,
+            q4_0
+        };
+
+        // The names of the quantization types (in the order of the enumeration)
+        std::vector<std::string> getTypeNames();
+
+        // Returns the path of a quantized version of the source model stored in the cache directory.
+        // The quantized model is generated at the first call and reused later if the source model and
+        // the cached model match the sizes and modification times (or the hashes if they differ)
+        // stored next to the cached model.
+        // If the source model is already quantized or if the quantization fails, the source path is returned.
+        std::filesystem::path getModel(std::filesystem::path const& source, std::filesystem::path const& cacheDirectory, Type type);
+
+        // The path of the quantized version of the source model in the cache directory
+        // (the file storing the hashes has the same path with the .hash extension)
+        std::filesystem::path getCachePath(std::filesystem::path const& source, std::filesystem::path const& cacheDirectory, Type type);
+
+        // Returns true if the quantized version of the source model is in the cache and still valid
+        bool isCached(std::filesystem::path const& source, std::filesystem::path const& cacheDirectory, Type type);
+
+        // The FNV-1a 64 bits hash of a file content
+        uint64_t getHash(std::filesystem::path const& path);
+    } // namespace Quantizer
+} // namespace Wvp
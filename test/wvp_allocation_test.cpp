@@ -0,0 +1,317 @@
+#include "wvp.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Tracks the heap allocations of the whole process while enabled: each allocation records whether it has
+// been made inside whisper, whether it's still alive and whether it has been released with the feature set.
+// A release is matched with the newest live allocation at the same address because addresses are reused.
+struct Allocation
+{
+    void* ptr;
+    bool isWhisper;
+    bool isAlive;
+    bool isReleasedWithFeatures;
+};
+
+static std::mutex gMutex;
+static std::atomic<bool> gTracking{false};
+static std::atomic<bool> gInWhisper{false};
+static std::atomic<bool> gReleasingFeatures{false};
+static std::array<Allocation, 1 << 16> gAllocations;
+static size_t gNumAllocations{0};
+
+static void* allocate(std::size_t size)
+{
+    auto* ptr = std::malloc(size == 0 ? 1 : size);
+    if(ptr != nullptr && gTracking.load())
+    {
+        std::lock_guard<std::mutex> lock(gMutex);
+        if(gNumAllocations < gAllocations.size())
+        {
+            gAllocations[gNumAllocations] = {ptr, gInWhisper.load(), true, false};
+        }
+        ++gNumAllocations;
+    }
+    return ptr;
+}
+
+static void release(void* ptr)
+{
+    if(ptr != nullptr && gTracking.load())
+    {
+        std::lock_guard<std::mutex> lock(gMutex);
+        for(auto i = std::min(gNumAllocations, gAllocations.size()); i > 0; --i)
+        {
+            auto& allocation = gAllocations[i - 1];
+            if(allocation.ptr == ptr && allocation.isAlive)
+            {
+                allocation.isAlive = false;
+                allocation.isReleasedWithFeatures = gReleasingFeatures.load();
+                break;
+            }
+        }
+    }
+    std::free(ptr);
+}
+
+void* operator new(std::size_t size)
+{
+    if(auto* ptr = allocate(size))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    if(auto* ptr = allocate(size))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, std::nothrow_t const&) noexcept
+{
+    return allocate(size);
+}
+
+void* operator new[](std::size_t size, std::nothrow_t const&) noexcept
+{
+    return allocate(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    release(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    release(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    release(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept
+{
+    release(ptr);
+}
+
+void operator delete(void* ptr, std::nothrow_t const&) noexcept
+{
+    release(ptr);
+}
+
+void operator delete[](void* ptr, std::nothrow_t const&) noexcept
+{
+    release(ptr);
+}
+
+// Reads the samples of a mono 16 bits PCM WAV file
+static bool readWav(char const* path, std::vector<float>& samples, int& sampleRate)
+{
+    std::ifstream stream(path, std::ios::binary);
+    char header[12];
+    if(!stream.read(header, sizeof(header)) || std::memcmp(header, "RIFF", 4) != 0 || std::memcmp(header + 8, "WAVE", 4) != 0)
+    {
+        return false;
+    }
+    char id[4];
+    uint32_t size;
+    uint16_t numChannels = 0, bitsPerSample = 0;
+    while(stream.read(id, 4) && stream.read(reinterpret_cast<char*>(&size), sizeof(size)))
+    {
+        if(std::memcmp(id, "fmt ", 4) == 0 && size >= 16)
+        {
+            uint16_t format;
+            uint32_t rate;
+            stream.read(reinterpret_cast<char*>(&format), sizeof(format));
+            stream.read(reinterpret_cast<char*>(&numChannels), sizeof(numChannels));
+            stream.read(reinterpret_cast<char*>(&rate), sizeof(rate));
+            stream.seekg(6, std::ios::cur);
+            stream.read(reinterpret_cast<char*>(&bitsPerSample), sizeof(bitsPerSample));
+            stream.seekg(static_cast<std::streamoff>(size - 16 + (size & 1)), std::ios::cur);
+            sampleRate = static_cast<int>(rate);
+            if(format != 1 || numChannels != 1 || bitsPerSample != 16)
+            {
+                return false;
+            }
+        }
+        else if(std::memcmp(id, "data", 4) == 0 && bitsPerSample == 16)
+        {
+            std::vector<int16_t> data(size / sizeof(int16_t));
+            stream.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size() * sizeof(int16_t)));
+            samples.resize(data.size());
+            for(size_t i = 0; i < data.size(); ++i)
+            {
+                samples[i] = static_cast<float>(data[i]) / 32768.0f;
+            }
+            return static_cast<bool>(stream);
+        }
+        else
+        {
+            stream.seekg(static_cast<std::streamoff>(size + (size & 1)), std::ios::cur);
+        }
+    }
+    return false;
+}
+
+// The allocations owned by a feature set: the node of the map, the storage of the feature list
+// (reserved once) and the label (if longer than the small string buffer) and values of each feature
+static size_t getBudget(Vamp::Plugin::FeatureSet const& fs)
+{
+    size_t budget = 0;
+    for(auto const& output : fs)
+    {
+        budget += 1 + (output.second.capacity() > 0 ? 1 : 0);
+        for(auto const& feature : output.second)
+        {
+            budget += feature.label.capacity() > std::string().capacity() ? 1 : 0;
+            budget += feature.values.capacity() > 0 ? 1 : 0;
+        }
+    }
+    return budget;
+}
+
+int main(int argc, char* argv[])
+{
+    static auto constexpr blockSize = static_cast<size_t>(1024);
+    static auto constexpr regionDuration = 2;
+
+    std::vector<float> samples;
+    auto sampleRate = 0;
+    if(argc < 2 || !readWav(argv[1], samples, sampleRate))
+    {
+        std::cerr << "Usage: wvp_allocation_test <mono 16 bits WAV file>\n";
+        return EXIT_FAILURE;
+    }
+
+    Wvp::Plugin plugin(static_cast<float>(sampleRate));
+    if(!plugin.initialise(1, blockSize, blockSize))
+    {
+        std::cerr << "Failed to initialise the plugin\n";
+        return EXIT_FAILURE;
+    }
+
+    // The input regions trigger a transcription every few seconds during the processing
+    Vamp::Plugin::FeatureSet regions;
+    for(size_t position = 0; position < samples.size(); position += static_cast<size_t>(regionDuration * sampleRate))
+    {
+        Vamp::Plugin::Feature region;
+        region.hasTimestamp = true;
+        region.timestamp = Vamp::RealTime::frame2RealTime(static_cast<long>(position), sampleRate);
+        regions[0].push_back(region);
+    }
+
+    size_t numBlocks = 0;
+    size_t numTranscriptions = 0;
+    size_t numExtraAllocations = 0;
+    size_t numWhisperAllocations = 0;
+    std::vector<float> block(blockSize);
+    float const* buffers[] = {block.data()};
+    auto const count = [&](auto&& function, bool enabled)
+    {
+        gNumAllocations = 0;
+        gTracking = enabled;
+        auto fs = function();
+        auto const isTranscription = !fs.empty();
+        auto const budget = getBudget(fs);
+        gReleasingFeatures = true;
+        fs.clear();
+        gReleasingFeatures = false;
+        gTracking = false;
+        if(!enabled)
+        {
+            return;
+        }
+        if(gNumAllocations > gAllocations.size())
+        {
+            std::cerr << "Too many allocations to track\n";
+            ++numExtraAllocations;
+            return;
+        }
+
+        // Apart from whisper, the only allocations must be the ones owned by the feature set:
+        // allocated during the call, still alive after it and released with the feature set
+        size_t numOwnedAllocations = 0;
+        for(size_t i = 0; i < gNumAllocations; ++i)
+        {
+            auto const& allocation = gAllocations[i];
+            if(allocation.isWhisper)
+            {
+                ++numWhisperAllocations;
+            }
+            else if(allocation.isReleasedWithFeatures)
+            {
+                ++numOwnedAllocations;
+            }
+            else
+            {
+                ++numExtraAllocations;
+            }
+        }
+        numExtraAllocations += std::max(numOwnedAllocations, budget) - std::min(numOwnedAllocations, budget);
+        ++(isTranscription ? numTranscriptions : numBlocks);
+    };
+
+    auto const run = [&](bool enabled)
+    {
+        plugin.setPreComputingFeatures(regions);
+        for(size_t position = 0; position < samples.size(); position += blockSize)
+        {
+            auto const numSamples = std::min(blockSize, samples.size() - position);
+            std::copy_n(samples.cbegin() + static_cast<std::ptrdiff_t>(position), numSamples, block.begin());
+            std::fill(block.begin() + static_cast<std::ptrdiff_t>(numSamples), block.end(), 0.0f);
+            auto const timestamp = Vamp::RealTime::frame2RealTime(static_cast<long>(position), sampleRate);
+            count([&]()
+                  {
+                      return plugin.process(buffers, timestamp);
+                  },
+                  enabled);
+        }
+        count([&]()
+              {
+                  return plugin.getRemainingFeatures();
+              },
+              enabled);
+    };
+
+    Wvp::setTranscriptionHook([](bool started)
+                              {
+                                  gInWhisper = started;
+                              });
+
+    // Warm-up: the first run grows the buffers to their steady-state capacity
+    run(false);
+
+    gNumAllocations = 0;
+    gTracking = true;
+    plugin.reset();
+    gTracking = false;
+    auto const numResetAllocations = gNumAllocations;
+
+    run(true);
+
+    std::cout << "Allocations during reset: " << numResetAllocations << "\n";
+    std::cout << "Unexpected allocations during process: " << numExtraAllocations << " (" << numBlocks << " blocks without transcription, " << numTranscriptions << " transcriptions)\n";
+    std::cout << "Internal allocations of whisper during the transcriptions: " << numWhisperAllocations << "\n";
+    if(numTranscriptions == 0)
+    {
+        std::cerr << "No transcription has been performed\n";
+        return EXIT_FAILURE;
+    }
+    return numResetAllocations == 0 && numExtraAllocations == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
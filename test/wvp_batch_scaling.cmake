@@ -0,0 +1,31 @@
+# Measures the throughput of wvp_batch with an increasing number of workers on copies of the same audio file
+# Usage: cmake -DWVP_BATCH=<executable> -DINPUT=<wav file> -DWORK_DIR=<directory> [-DNUM_FILES=<number>] -P wvp_batch_scaling.cmake
+
+if(NOT NUM_FILES)
+  set(NUM_FILES 32)
+endif()
+
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${WORK_DIR}/input)
+foreach(WVP_INDEX RANGE 1 ${NUM_FILES})
+  file(COPY_FILE ${INPUT} ${WORK_DIR}/input/file${WVP_INDEX}.wav)
+endforeach()
+
+# Each worker uses up to 4 threads for the inference
+cmake_host_system_information(RESULT WVP_NUM_CORES QUERY NUMBER_OF_LOGICAL_CORES)
+math(EXPR WVP_MAX_JOBS "${WVP_NUM_CORES} / 4")
+if(WVP_MAX_JOBS LESS 2)
+  set(WVP_MAX_JOBS 2)
+endif()
+
+set(WVP_JOBS 1)
+while(WVP_JOBS LESS_EQUAL WVP_MAX_JOBS)
+  execute_process(COMMAND ${WVP_BATCH} --jobs ${WVP_JOBS} --output ${WORK_DIR}/output ${WORK_DIR}/input RESULT_VARIABLE WVP_RESULT ERROR_VARIABLE WVP_LOG)
+  if(NOT WVP_RESULT EQUAL 0)
+    message(FATAL_ERROR "wvp_batch failed (${WVP_RESULT}):\n${WVP_LOG}")
+  endif()
+  string(REGEX MATCH "Processed [^\n]*" WVP_SUMMARY "${WVP_LOG}")
+  message(STATUS "${WVP_SUMMARY}")
+  math(EXPR WVP_JOBS "${WVP_JOBS} * 2")
+endwhile()
+message(STATUS "${NUM_FILES} files on ${WVP_NUM_CORES} logical cores")
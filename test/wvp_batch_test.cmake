@@ -0,0 +1,34 @@
+# Runs wvp_batch on test/row.wav and checks the generated JSON file
+# Usage: cmake -DWVP_BATCH=<executable> -DINPUT=<wav file> -DOUTPUT_DIR=<directory> -P wvp_batch_test.cmake
+
+file(REMOVE_RECURSE ${OUTPUT_DIR})
+execute_process(COMMAND ${WVP_BATCH} --parameter splitmode=1 --output ${OUTPUT_DIR} ${INPUT} RESULT_VARIABLE WVP_RESULT)
+if(NOT WVP_RESULT EQUAL 0)
+  message(FATAL_ERROR "wvp_batch failed (${WVP_RESULT})")
+endif()
+
+cmake_path(GET INPUT STEM WVP_STEM)
+set(WVP_OUTPUT "${OUTPUT_DIR}/${WVP_STEM}.json")
+if(NOT EXISTS ${WVP_OUTPUT})
+  message(FATAL_ERROR "The result file ${WVP_OUTPUT} has not been generated")
+endif()
+file(READ ${WVP_OUTPUT} WVP_CONTENT)
+
+if(NOT WVP_CONTENT MATCHES "\"duration\": 8\\.6")
+  message(FATAL_ERROR "Invalid duration in ${WVP_OUTPUT}")
+endif()
+
+string(REGEX MATCHALL "\"label\": " WVP_LABELS "${WVP_CONTENT}")
+list(LENGTH WVP_LABELS WVP_NUM_LABELS)
+if(WVP_NUM_LABELS LESS 4)
+  message(FATAL_ERROR "Only ${WVP_NUM_LABELS} words in ${WVP_OUTPUT}")
+endif()
+
+# The audio file is a spoken version of "Row, row, row your boat"
+string(TOLOWER "${WVP_CONTENT}" WVP_CONTENT)
+foreach(WVP_WORD IN ITEMS "row" "boat")
+  if(NOT WVP_CONTENT MATCHES "\"label\": \"[^\"]*${WVP_WORD}")
+    message(FATAL_ERROR "The word '${WVP_WORD}' is missing in ${WVP_OUTPUT}")
+  endif()
+endforeach()
+message(STATUS "${WVP_NUM_LABELS} words in ${WVP_OUTPUT}")
@@ -0,0 +1,257 @@
+#include "wvp_quantizer.h"
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <ggml.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <whisper.h>
+
+namespace Wvp
+{
+    namespace Test
+    {
+        static auto constexpr gNumStates = 64;
+        static auto constexpr gNumLayers = 4;
+        static auto constexpr gNumMels = 80;
+        static auto constexpr gNumAudioCtx = 1500;
+        static auto constexpr gNumTextCtx = 448;
+        static auto constexpr gNumVocab = 51864;
+        static auto constexpr gNumFft = 201;
+
+        struct Tensor
+        {
+            std::string name;
+            std::vector<int32_t> ne;
+        };
+
+        // The tensors expected by the loader of whisper.cpp (the vocabulary is generated by the loader)
+        static std::vector<Tensor> getTensors()
+        {
+            std::vector<Tensor> tensors;
+            auto const addLinear = [&](std::string const& name, int32_t numInputs, int32_t numOutputs, bool hasBias)
+            {
+                tensors.push_back({name + ".weight", {numInputs, numOutputs}});
+                if(hasBias)
+                {
+                    tensors.push_back({name + ".bias", {numOutputs}});
+                }
+            };
+            auto const addNorm = [&](std::string const& name)
+            {
+                tensors.push_back({name + ".weight", {gNumStates}});
+                tensors.push_back({name + ".bias", {gNumStates}});
+            };
+            auto const addAttention = [&](std::string const& name)
+            {
+                addLinear(name + ".query", gNumStates, gNumStates, true);
+                addLinear(name + ".key", gNumStates, gNumStates, false);
+                addLinear(name + ".value", gNumStates, gNumStates, true);
+                addLinear(name + ".out", gNumStates, gNumStates, true);
+            };
+            auto const addBlock = [&](std::string const& name, bool hasCrossAttention)
+            {
+                addNorm(name + ".mlp_ln");
+                addLinear(name + ".mlp.0", gNumStates, 4 * gNumStates, true);
+                addLinear(name + ".mlp.2", 4 * gNumStates, gNumStates, true);
+                addNorm(name + ".attn_ln");
+                addAttention(name + ".attn");
+                if(hasCrossAttention)
+                {
+                    addNorm(name + ".cross_attn_ln");
+                    addAttention(name + ".cross_attn");
+                }
+            };
+
+            tensors.push_back({"encoder.positional_embedding", {gNumStates, gNumAudioCtx}});
+            tensors.push_back({"encoder.conv1.weight", {3, gNumMels, gNumStates}});
+            tensors.push_back({"encoder.conv1.bias", {1, gNumStates}});
+            tensors.push_back({"encoder.conv2.weight", {3, gNumStates, gNumStates}});
+            tensors.push_back({"encoder.conv2.bias", {1, gNumStates}});
+            addNorm("encoder.ln_post");
+            for(auto i = 0; i < gNumLayers; ++i)
+            {
+                addBlock("encoder.blocks." + std::to_string(i), false);
+            }
+            tensors.push_back({"decoder.positional_embedding", {gNumStates, gNumTextCtx}});
+            tensors.push_back({"decoder.token_embedding.weight", {gNumStates, gNumVocab}});
+            addNorm("decoder.ln");
+            for(auto i = 0; i < gNumLayers; ++i)
+            {
+                addBlock("decoder.blocks." + std::to_string(i), true);
+            }
+            return tensors;
+        }
+
+        template <typename T>
+        static void write(std::ofstream& stream, T const& value)
+        {
+            stream.write(reinterpret_cast<char const*>(&value), sizeof(T));
+        }
+
+        // Writes a tiny model with random weights using the same layout as the conversion script of whisper.cpp
+        static bool createModel(std::filesystem::path const& path, bool halfPrecision)
+        {
+            std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+            write(stream, static_cast<uint32_t>(0x67676d6c));
+            std::array<int32_t, 11> const hparams{gNumVocab, gNumAudioCtx, gNumStates, 1, gNumLayers, gNumTextCtx, gNumStates, 1, gNumLayers, gNumMels, halfPrecision ? 1 : 0};
+            for(auto const& hparam : hparams)
+            {
+                write(stream, hparam);
+            }
+            write(stream, static_cast<int32_t>(gNumMels));
+            write(stream, static_cast<int32_t>(gNumFft));
+            for(auto i = 0; i < gNumMels * gNumFft; ++i)
+            {
+                write(stream, 0.0f);
+            }
+            write(stream, static_cast<int32_t>(0));
+
+            uint32_t seed = 1;
+            std::vector<float> values;
+            std::vector<ggml_fp16_t> halfValues;
+            for(auto const& tensor : getTensors())
+            {
+                size_t nElements = 1;
+                for(auto const& ne : tensor.ne)
+                {
+                    nElements *= static_cast<size_t>(ne);
+                }
+                values.resize(nElements);
+                for(auto& value : values)
+                {
+                    seed = seed * 1664525u + 1013904223u;
+                    value = static_cast<float>(seed >> 8) / static_cast<float>(1 << 24) - 0.5f;
+                }
+                auto const isFloat = tensor.ne.size() < 2 || tensor.name == "encoder.conv1.bias" || tensor.name == "encoder.conv2.bias" || tensor.name.find("positional_embedding") != std::string::npos;
+                auto const ttype = halfPrecision && !isFloat ? GGML_TYPE_F16 : GGML_TYPE_F32;
+                write(stream, static_cast<int32_t>(tensor.ne.size()));
+                write(stream, static_cast<int32_t>(tensor.name.size()));
+                write(stream, static_cast<int32_t>(ttype));
+                for(auto const& ne : tensor.ne)
+                {
+                    write(stream, ne);
+                }
+                stream.write(tensor.name.data(), static_cast<std::streamsize>(tensor.name.size()));
+                if(ttype == GGML_TYPE_F16)
+                {
+                    halfValues.resize(nElements);
+                    ggml_fp32_to_fp16_row(values.data(), halfValues.data(), static_cast<int64_t>(nElements));
+                    stream.write(reinterpret_cast<char const*>(halfValues.data()), static_cast<std::streamsize>(nElements * sizeof(ggml_fp16_t)));
+                }
+                else
+                {
+                    stream.write(reinterpret_cast<char const*>(values.data()), static_cast<std::streamsize>(nElements * sizeof(float)));
+                }
+            }
+            return static_cast<bool>(stream);
+        }
+
+        static bool canLoad(std::filesystem::path const& path)
+        {
+            auto* context = whisper_init_from_file_with_params_no_state(path.string().c_str(), whisper_context_default_params());
+            if(context == nullptr)
+            {
+                return false;
+            }
+            whisper_free(context);
+            return true;
+        }
+
+        static bool check(bool condition, std::string const& description)
+        {
+            std::cout << (condition ? "[OK] " : "[FAILED] ") << description << "\n";
+            return condition;
+        }
+    } // namespace Test
+} // namespace Wvp
+
+int main(int argc, char* argv[])
+{
+    using namespace Wvp;
+    using namespace Wvp::Test;
+
+    auto const directory = argc > 1 ? std::filesystem::path(argv[1]) : std::filesystem::temp_directory_path() / "wvp_quantizer_test";
+    std::error_code ec;
+    std::filesystem::remove_all(directory, ec);
+    std::filesystem::create_directories(directory / "models", ec);
+    auto const cache = directory / "cache";
+
+    // A date in the past used to know if a cached model has been regenerated
+    auto const marker = std::filesystem::file_time_type::clock::now() - std::chrono::hours(24);
+    auto const isMarked = [&](std::filesystem::path const& path)
+    {
+        return std::filesystem::last_write_time(path) == marker;
+    };
+
+    auto succeeded = true;
+    for(auto const halfPrecision : {true, false})
+    {
+        auto const name = std::string(halfPrecision ? "f16" : "f32");
+        auto const source = directory / "models" / ("ggml-test-" + name + ".bin");
+        if(!check(createModel(source, halfPrecision) && canLoad(source), name + ": create and load the source model"))
+        {
+            return EXIT_FAILURE;
+        }
+
+        auto const typeNames = Quantizer::getTypeNames();
+        for(size_t i = 1; i < typeNames.size(); ++i)
+        {
+            auto const type = static_cast<Quantizer::Type>(i);
+            auto const model = Quantizer::getModel(source, cache, type);
+            succeeded = check(model != source && model == Quantizer::getCachePath(source, cache, type), name + " -> " + typeNames.at(i) + ": quantize the model") && succeeded;
+            succeeded = check(Quantizer::isCached(source, cache, type) && canLoad(model), name + " -> " + typeNames.at(i) + ": load the quantized model") && succeeded;
+            succeeded = check(Quantizer::getModel(model, cache, type) == model, name + " -> " + typeNames.at(i) + ": ignore the quantized model") && succeeded;
+        }
+
+        auto const type = Quantizer::Type::q8_0;
+        auto const model = Quantizer::getCachePath(source, cache, type);
+        auto const sidecar = std::filesystem::path(model).replace_extension(".hash");
+
+        // The modification time differs from the one stored but the content is the same
+        std::filesystem::last_write_time(model, marker);
+        succeeded = check(Quantizer::getModel(source, cache, type) == model && isMarked(model), name + ": reuse the cached model with another modification time") && succeeded;
+        succeeded = check(Quantizer::getModel(source, cache, type) == model && isMarked(model), name + ": reuse the cached model") && succeeded;
+
+        // Modifying the source model regenerates the cached model
+        {
+            std::fstream stream(source, std::ios::binary | std::ios::in | std::ios::out);
+            auto const value = 0.25f;
+            stream.seekp(-static_cast<std::streamoff>(sizeof(value)), std::ios::end);
+            stream.write(reinterpret_cast<char const*>(&value), sizeof(value));
+        }
+        succeeded = check(!Quantizer::isCached(source, cache, type), name + ": invalidate the cached model if the source changes") && succeeded;
+        succeeded = check(Quantizer::getModel(source, cache, type) == model && !isMarked(model) && canLoad(model), name + ": regenerate the cached model if the source changes") && succeeded;
+
+        // Modifying the hash file regenerates the cached model
+        std::filesystem::last_write_time(model, marker);
+        {
+            std::ofstream stream(sidecar, std::ios::trunc);
+            stream << "0\n";
+        }
+        succeeded = check(!Quantizer::isCached(source, cache, type), name + ": invalidate the cached model if the hash file changes") && succeeded;
+        succeeded = check(Quantizer::getModel(source, cache, type) == model && !isMarked(model) && canLoad(model), name + ": regenerate the cached model if the hash file changes") && succeeded;
+
+        // Modifying the cached model regenerates it
+        {
+            std::ofstream stream(model, std::ios::binary | std::ios::app);
+            stream << "0";
+        }
+        std::filesystem::last_write_time(model, marker);
+        succeeded = check(Quantizer::getModel(source, cache, type) == model && !isMarked(model) && canLoad(model), name + ": regenerate the cached model if it changes") && succeeded;
+    }
+
+    // Models with the same name in different directories use different cached models
+    {
+        std::filesystem::create_directories(directory / "other", ec);
+        auto const source = directory / "models" / "ggml-test-f16.bin";
+        auto const other = directory / "other" / "ggml-test-f16.bin";
+        std::filesystem::copy_file(source, other, std::filesystem::copy_options::overwrite_existing, ec);
+        succeeded = check(Quantizer::getCachePath(source, cache, Quantizer::Type::q8_0) != Quantizer::getCachePath(other, cache, Quantizer::Type::q8_0), "use different cached models for different sources") && succeeded;
+    }
+
+    std::filesystem::remove_all(directory, ec);
+    return succeeded ? EXIT_SUCCESS : EXIT_FAILURE;
+}